@@ -2,6 +2,9 @@
 #include <powrprof.h>
 #include <algorithm>
 #include <memory>
+#include "pbs_journal.h"
+#include "pbs_lease.h"
+#include "pbs_engine.h"
 
 #pragma comment(lib, "PowrProf.lib")
 #pragma comment(lib, "User32.lib")
@@ -17,9 +20,26 @@ constexpr GUID GUID_DISPLAY_STATE =
     { 0x6fe69556,0x704a,0x47a0,{0x8f,0x24,0xc2,0x8d,0x93,0x6f,0xda,0x47} };
 
 #define TIMER_ID 1
+#define LEASE_TIMER_ID 2
 #define DEBOUNCE_MS 600
+#define WM_LEASE_WAKE (WM_APP + 1)
+
+std::unique_ptr<EngineLease> g_lease;
+std::unique_ptr<EngineEvents> g_engine;
+
+bool IsElevated() {
+    HANDLE token = nullptr;
+    if (!OpenProcessToken(GetCurrentProcess(), TOKEN_QUERY, &token)) return false;
+    TOKEN_ELEVATION elevation{};
+    DWORD len = 0;
+    BOOL ok = GetTokenInformation(token, TokenElevation, &elevation, sizeof(elevation), &len);
+    CloseHandle(token);
+    return ok && elevation.TokenIsElevated;
+}
 
 void SyncBrightness() {
+    LONG gen = g_lease->Generation();
+
     GUID* active = nullptr;
     if (PowerGetActiveScheme(nullptr, &active) != ERROR_SUCCESS) return;
     
@@ -37,12 +57,25 @@ void SyncBrightness() {
 
     currentBrightness = std::clamp<DWORD>(currentBrightness, 0, 100);
 
-    DWORD idx = 0;
+    static SyncJournal journal(L"sync.journal");
+    DWORD idx = journal.ResumeIndex(currentBrightness);
+    journal.Begin(currentBrightness, idx);
+
     while (true) {
         GUID scheme;
         DWORD size = sizeof(scheme);
-        if (PowerEnumerate(nullptr, nullptr, nullptr, ACCESS_SCHEME, idx++, (UCHAR*)&scheme, &size) != ERROR_SUCCESS)
+        DWORD err = PowerEnumerate(nullptr, nullptr, nullptr, ACCESS_SCHEME, idx, (UCHAR*)&scheme, &size);
+        if (err != ERROR_SUCCESS) {
+            if (err == ERROR_NO_MORE_ITEMS) {
+                journal.Done();
+                g_lease->MarkSynced(gen);
+            } else {
+                journal.Interrupt(idx);
+            }
             break;
+        }
+        idx++;
+        if (!g_lease->Heartbeat()) return;
 
         DWORD val = 0;
         if (PowerReadACValueIndex(nullptr, &scheme, &GUID_VIDEO_SUBGROUP, &GUID_BRIGHTNESS, &val) == ERROR_SUCCESS) {
@@ -54,6 +87,8 @@ void SyncBrightness() {
             if (val != currentBrightness)
                 PowerWriteDCValueIndex(nullptr, &scheme, &GUID_VIDEO_SUBGROUP, &GUID_BRIGHTNESS, currentBrightness);
         }
+
+        journal.Progress(idx, scheme);
     }
 }
 
@@ -72,15 +107,24 @@ LRESULT CALLBACK WndProc(HWND h, UINT m, WPARAM w, LPARAM l) {
             }
         }
 
-        if (shouldTrigger) {
-            SetTimer(h, TIMER_ID, DEBOUNCE_MS, nullptr);
-        }
+        if (shouldTrigger) g_engine->OnPowerEvent();
         return TRUE;
     }
     
     if (m == WM_TIMER && w == TIMER_ID) {
         KillTimer(h, TIMER_ID);
-        SyncBrightness();
+        g_engine->OnDebounce();
+        return 0;
+    }
+
+    if (m == WM_TIMER && w == LEASE_TIMER_ID) {
+        KillTimer(h, LEASE_TIMER_ID);
+        g_engine->OnLeaseCheck();
+        return 0;
+    }
+
+    if (m == WM_LEASE_WAKE) {
+        g_engine->OnWake();
         return 0;
     }
 
@@ -88,6 +132,8 @@ LRESULT CALLBACK WndProc(HWND h, UINT m, WPARAM w, LPARAM l) {
 }
 
 int APIENTRY wWinMain(HINSTANCE hInst, HINSTANCE, LPWSTR, int) {
+    if (!IsElevated()) return 0;
+
     HANDLE hMutex = CreateMutexW(nullptr, TRUE, L"Global\\PBS_Minimal_Lock");
     if (!hMutex || GetLastError() == ERROR_ALREADY_EXISTS) {
         if (hMutex) CloseHandle(hMutex);
@@ -95,8 +141,6 @@ int APIENTRY wWinMain(HINSTANCE hInst, HINSTANCE, LPWSTR, int) {
     }
     std::unique_ptr<void, decltype(&CloseHandle)> mtxGuard(hMutex, CloseHandle);
 
-    SyncBrightness();
-
     WNDCLASSW wc = { 0 };
     wc.lpfnWndProc = WndProc;
     wc.hInstance = hInst;
@@ -107,6 +151,19 @@ int APIENTRY wWinMain(HINSTANCE hInst, HINSTANCE, LPWSTR, int) {
     HWND hwnd = CreateWindowExW(0, wc.lpszClassName, nullptr, 0, 0, 0, 0, 0, HWND_MESSAGE, nullptr, hInst, nullptr);
     if (!hwnd) return 0;
 
+    g_lease = std::make_unique<EngineLease>([](void* ctx) {
+        PostMessageW(static_cast<HWND>(ctx), WM_LEASE_WAKE, 0, 0);
+    }, hwnd);
+    if (!g_lease->valid()) return 0;
+
+    EngineHooks hooks{};
+    hooks.armDebounce = [](void* ctx) { SetTimer(static_cast<HWND>(ctx), TIMER_ID, DEBOUNCE_MS, nullptr); };
+    hooks.armLeaseCheck = [](void* ctx) { SetTimer(static_cast<HWND>(ctx), LEASE_TIMER_ID, kLeaseTimeoutMs, nullptr); };
+    hooks.sync = [](void*) { SyncBrightness(); };
+    hooks.ctx = hwnd;
+    g_engine = std::make_unique<EngineEvents>(*g_lease, hooks);
+    g_engine->Start();
+
     HPOWERNOTIFY hNot1 = RegisterPowerSettingNotification(hwnd, &GUID_BRIGHTNESS, DEVICE_NOTIFY_WINDOW_HANDLE);
     HPOWERNOTIFY hNot2 = RegisterPowerSettingNotification(hwnd, &GUID_DISPLAY_STATE, DEVICE_NOTIFY_WINDOW_HANDLE);
 
@@ -120,5 +177,8 @@ int APIENTRY wWinMain(HINSTANCE hInst, HINSTANCE, LPWSTR, int) {
     if (hNot1) UnregisterPowerSettingNotification(hNot1);
     if (hNot2) UnregisterPowerSettingNotification(hNot2);
 
+    g_engine.reset();
+    g_lease.reset();
+
     return 0;
 }
\ No newline at end of file
@@ -9,6 +9,9 @@
 #include <memory>
 #include <vector>
 #include <atomic>
+#include "pbs_journal.h"
+#include "pbs_lease.h"
+#include "pbs_engine.h"
 
 using Microsoft::WRL::ComPtr;
 
@@ -29,7 +32,13 @@ constexpr GUID kGuidVideoBrightness = { 0xaded5e82,0xb909,0x4619,{0x99,0x49,0xf5
 constexpr GUID kGuidConsoleDisplayState = { 0x6fe69556, 0x704a, 0x47a0, { 0x8f, 0x24, 0xc2, 0x8d, 0x93, 0x6f, 0xda, 0x47 } };
 
 #define ID_TIMER_DEBOUNCE 1
+#define ID_TIMER_LEASE 2
 #define DEBOUNCE_DELAY_MS 600
+#define WM_LEASE_WAKE (WM_APP + 1)
+
+// Shared with the Lite build and the service; only the holder syncs
+std::unique_ptr<EngineLease> g_lease;
+std::unique_ptr<EngineEvents> g_engine;
 
 // ================= Helper Functions =================
 
@@ -54,6 +63,8 @@ void PerformSync() {
     struct SyncGuard {
         ~SyncGuard() { syncing = false; }
     } syncGuard;
+    LONG gen = g_lease->Generation();
+
     GUID* pActive = nullptr;
     if (PowerGetActiveScheme(nullptr, &pActive) != ERROR_SUCCESS) return;
 
@@ -81,8 +92,12 @@ void PerformSync() {
     // Limit range
     currentBrightness = std::clamp<DWORD>(currentBrightness, 0, 100);
 
+    // Resume an interrupted sweep (e.g. after taskkill /f) if the target is unchanged
+    static SyncJournal journal(L"sync.journal");
+    DWORD index = journal.ResumeIndex(currentBrightness);
+    journal.Begin(currentBrightness, index);
+
     // Iterate all schemes, unify AC and DC brightness to the current value
-    DWORD index = 0;
     while (true) {
         GUID scheme;
         DWORD bufSize = sizeof(scheme);
@@ -93,10 +108,20 @@ void PerformSync() {
             err = PowerEnumerate(nullptr, nullptr, nullptr, ACCESS_SCHEME, index, (UCHAR*)&scheme, &bufSize);
         }
         if (err != ERROR_SUCCESS) {
+            // Only a finished enumeration completes the sweep; keep the checkpoint otherwise
+            if (err == ERROR_NO_MORE_ITEMS) {
+                journal.Done();
+                g_lease->MarkSynced(gen);
+            } else {
+                journal.Interrupt(index);
+            }
             break;
         }
         index++;
 
+        // Taken over while stalled: the new holder owns the rest of the sweep and the journal
+        if (!g_lease->Heartbeat()) return;
+
         // Read and update AC value
         DWORD tempVal = 0;
         if (PowerReadACValueIndex(nullptr, &scheme, &kGuidSubVideo, &kGuidVideoBrightness, &tempVal) == ERROR_SUCCESS) {
@@ -112,6 +137,8 @@ void PerformSync() {
                 PowerWriteDCValueIndex(nullptr, &scheme, &kGuidSubVideo, &kGuidVideoBrightness, currentBrightness);
             }
         }
+
+        journal.Progress(index, scheme);
     }
 }
 
@@ -229,8 +256,7 @@ LRESULT CALLBACK WndProc(HWND hwnd, UINT msg, WPARAM wp, LPARAM lp) {
             auto pbs = (PPOWERBROADCAST_SETTING)lp;
             if (IsEqualGUID(pbs->PowerSetting, kGuidVideoBrightness) || 
                 IsEqualGUID(pbs->PowerSetting, kGuidConsoleDisplayState)) {
-                KillTimer(hwnd, ID_TIMER_DEBOUNCE); // Prevent stacking
-                SetTimer(hwnd, ID_TIMER_DEBOUNCE, DEBOUNCE_DELAY_MS, nullptr);
+                g_engine->OnPowerEvent();
             }
         }
         return TRUE;
@@ -238,10 +264,17 @@ LRESULT CALLBACK WndProc(HWND hwnd, UINT msg, WPARAM wp, LPARAM lp) {
     case WM_TIMER:
         if (wp == ID_TIMER_DEBOUNCE) {
             KillTimer(hwnd, ID_TIMER_DEBOUNCE);
-            PerformSync();
+            g_engine->OnDebounce(); // Syncs, or hands the event to the lease holder
+        } else if (wp == ID_TIMER_LEASE) {
+            KillTimer(hwnd, ID_TIMER_LEASE);
+            g_engine->OnLeaseCheck();
         }
         return 0;
 
+    case WM_LEASE_WAKE:
+        g_engine->OnWake();
+        return 0;
+
     case WM_DESTROY:
         PostQuitMessage(0);
         return 0;
@@ -296,9 +329,6 @@ int APIENTRY wWinMain(HINSTANCE hInst, HINSTANCE, LPWSTR, int) {
     // Runtime check
     if (!IsAdministrator()) return 0; 
 
-    // Initial sync
-    PerformSync();
-
     // Window creation
     WNDCLASSW wc = { 0 };
     wc.lpfnWndProc = WndProc;
@@ -309,6 +339,29 @@ int APIENTRY wWinMain(HINSTANCE hInst, HINSTANCE, LPWSTR, int) {
     HWND hwnd = CreateWindowExW(0, wc.lpszClassName, nullptr, 0, 0, 0, 0, 0, HWND_MESSAGE, nullptr, hInst, nullptr);
     if (!hwnd) return 1;
 
+    // Join the engine lease; its wakeups are handled on this thread so a hung loop counts as hung
+    g_lease = std::make_unique<EngineLease>([](void* ctx) {
+        PostMessageW(static_cast<HWND>(ctx), WM_LEASE_WAKE, 0, 0);
+    }, hwnd);
+    if (!g_lease->valid()) {
+        // Never run as a second engine next to the lease holder
+        DestroyWindow(hwnd);
+        return 1;
+    }
+
+    EngineHooks hooks{};
+    hooks.armDebounce = [](void* ctx) {
+        KillTimer(static_cast<HWND>(ctx), ID_TIMER_DEBOUNCE); // Prevent stacking
+        SetTimer(static_cast<HWND>(ctx), ID_TIMER_DEBOUNCE, DEBOUNCE_DELAY_MS, nullptr);
+    };
+    hooks.armLeaseCheck = [](void* ctx) { SetTimer(static_cast<HWND>(ctx), ID_TIMER_LEASE, kLeaseTimeoutMs, nullptr); };
+    hooks.sync = [](void*) { PerformSync(); };
+    hooks.ctx = hwnd;
+    g_engine = std::make_unique<EngineEvents>(*g_lease, hooks);
+
+    // Initial sync
+    g_engine->Start();
+
     // Register notifications
     HPOWERNOTIFY hN1 = RegisterPowerSettingNotification(hwnd, &kGuidVideoBrightness, DEVICE_NOTIFY_WINDOW_HANDLE);
     HPOWERNOTIFY hN2 = RegisterPowerSettingNotification(hwnd, &kGuidConsoleDisplayState, DEVICE_NOTIFY_WINDOW_HANDLE);
@@ -333,5 +386,8 @@ int APIENTRY wWinMain(HINSTANCE hInst, HINSTANCE, LPWSTR, int) {
     if (hN1) UnregisterPowerSettingNotification(hN1);
     if (hN2) UnregisterPowerSettingNotification(hN2);
 
+    g_engine.reset();
+    g_lease.reset();
+
     return (int)msg.wParam;
 }
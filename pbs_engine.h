@@ -0,0 +1,80 @@
+#pragma once
+
+// ================= Engine Events =================
+// What an engine does with each of its events, shared by the tray app, the
+// Lite build and tests/lease_test.cpp so the harness drives the same logic.
+// The host supplies its timers and its sync routine; every call must come
+// from the host's own event loop thread.
+//
+//   startup      -> Request() and Tick(), then as the debounce
+//   power event  -> Request(), restart the debounce
+//   debounce     -> holder: sync; passive: Forward() and arm the lease check
+//   lease check  -> Tick(), re-armed while a live holder is still working
+//   lease wake   -> Tick(); holder: debounce unless one is already pending
+//
+// Nothing here runs while idle: the lease check is only armed after a
+// Forward(), and the lease wake only arrives from another instance.
+
+#include "pbs_lease.h"
+
+struct EngineHooks {
+    void (*armDebounce)(void* ctx);    // (Re)start the debounce timer
+    void (*armLeaseCheck)(void* ctx);  // (Re)start a one-shot kLeaseTimeoutMs timer
+    void (*sync)(void* ctx);           // Sweep all schemes; only called on the holder
+    void* ctx;
+};
+
+class EngineEvents {
+public:
+    EngineEvents(EngineLease& lease, const EngineHooks& hooks) : lease_(lease), hooks_(hooks) {}
+
+    EngineEvents(const EngineEvents&) = delete;
+    EngineEvents& operator=(const EngineEvents&) = delete;
+
+    // The startup sync is a generation like any event, so it is not lost
+    // when another instance holds the lease (or dies before covering it)
+    void Start() {
+        lease_.Request();
+        lease_.Tick();
+        Run();
+    }
+
+    void OnPowerEvent() {
+        lease_.Request();
+        hooks_.armDebounce(hooks_.ctx);
+        debouncePending_ = true;
+    }
+
+    void OnDebounce() {
+        debouncePending_ = false;
+        Run();
+    }
+
+    void OnLeaseCheck() {
+        if (lease_.Tick()) hooks_.armLeaseCheck(hooks_.ctx);
+    }
+
+    // Forwarded by another instance, or the watched holder exited. We saw the
+    // same broadcast, so a pending debounce is left alone rather than pushed
+    // further out.
+    void OnWake() {
+        OnLeaseCheck();
+        if (lease_.IsHolder() && !debouncePending_ && lease_.HasBacklog()) {
+            hooks_.armDebounce(hooks_.ctx);
+            debouncePending_ = true;
+        }
+    }
+
+private:
+    void Run() {
+        if (lease_.IsHolder()) {
+            hooks_.sync(hooks_.ctx);
+        } else if (lease_.Forward()) {
+            hooks_.armLeaseCheck(hooks_.ctx); // Take over if the holder never gets to it
+        }
+    }
+
+    EngineLease& lease_;
+    EngineHooks hooks_;
+    bool debouncePending_ = false;
+};
@@ -0,0 +1,284 @@
+#pragma once
+
+// ================= Sync Journal =================
+// Tiny append-only journal that records how far a brightness sweep got.
+// A sweep logs a Begin record (target + start index), Checkpoint records as it
+// walks the schemes, and a Done record when it finishes. If the process is
+// killed mid-sweep, the next start resumes from the last checkpoint instead of
+// rewriting every scheme again. Each record also carries the GUID of the last
+// scheme it covered; if plans were imported or deleted in the meantime the
+// enumeration order no longer matches and a full sweep is done instead.
+//
+// A checkpoint is written after every scheme and never flushed with
+// FlushFileBuffers: a plain WriteFile lands in the system cache, which
+// survives the process being terminated, so it costs next to nothing. Only a power loss can drop the
+// tail, and then the next start simply does a full sweep as before.
+//
+// All engines share one journal file; only the engine lease holder (see
+// pbs_lease.h) writes to it, and a new holder picks up where the old one
+// stopped. A holder that lost the lease may still be mid-append, so every
+// append, truncate and read holds an exclusive lock on one byte far past the
+// end of the file. That works as a cross-process mutex tied to the file
+// itself without blocking access to the records.
+//
+// The engines run as SYSTEM or elevated, but any user can create folders
+// under ProgramData. The directory and file are created with a protected
+// DACL for SYSTEM and Administrators only, and an existing directory or file
+// is used only if it is owned by one of them and is not a reparse point, so
+// a pre-created folder, junction or link cannot redirect or forge records.
+
+#include <windows.h>
+#include <aclapi.h>
+#include <sddl.h>
+#include <powrprof.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+#pragma comment(lib, "Advapi32.lib")
+
+constexpr DWORD kJournalMagic = 0x4C4A4250;      // "PBJL"
+constexpr LONGLONG kJournalCompactBytes = 4096;  // Truncate after a Done once larger than this
+constexpr DWORD kJournalLockOffsetHigh = 0x7FFFFFFF;  // Lock byte offset, well past any real data
+
+// Protected DACL: SYSTEM and Administrators only, inherited by the journal file
+constexpr wchar_t kJournalSddl[] = L"D:P(A;OICI;FA;;;SY)(A;OICI;FA;;;BA)";
+
+enum JournalKind : DWORD {
+    kJournalBegin = 1,
+    kJournalCheckpoint = 2,
+    kJournalDone = 3,
+};
+
+struct JournalRecord {
+    DWORD magic;
+    DWORD kind;
+    DWORD target;
+    DWORD nextIndex;
+    GUID lastScheme;  // Scheme at nextIndex - 1, zero when nextIndex is 0
+    DWORD check;
+};
+
+inline DWORD JournalCheck(const JournalRecord& r) {
+    const DWORD* g = reinterpret_cast<const DWORD*>(&r.lastScheme);
+    return r.magic ^ (r.kind * 0x9E3779B9u) ^ (r.target << 8) ^ (r.nextIndex << 16) ^
+           g[0] ^ (g[1] * 3) ^ (g[2] * 5) ^ (g[3] * 7) ^ 0xA5A5A5A5u;
+}
+
+// True for a plain directory or single-link file owned by SYSTEM or Administrators.
+inline bool IsTrustedJournalObject(HANDLE h, bool directory) {
+    BY_HANDLE_FILE_INFORMATION info{};
+    if (!GetFileInformationByHandle(h, &info)) return false;
+    if (info.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) return false;
+    if (((info.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0) != directory) return false;
+    if (!directory && info.nNumberOfLinks != 1) return false;
+
+    PSID owner = nullptr;
+    PSECURITY_DESCRIPTOR sd = nullptr;
+    if (GetSecurityInfo(h, SE_FILE_OBJECT, OWNER_SECURITY_INFORMATION, &owner, nullptr, nullptr, nullptr, &sd) !=
+        ERROR_SUCCESS) {
+        return false;
+    }
+    bool trusted = IsWellKnownSid(owner, WinLocalSystemSid) || IsWellKnownSid(owner, WinBuiltinAdministratorsSid);
+    LocalFree(sd);
+    return trusted;
+}
+
+class SyncJournal {
+public:
+    // fileName is created under %ProgramData%\PowerBrightnessSync. If the
+    // journal cannot be opened or is not trusted every call below is a no-op.
+    explicit SyncJournal(const wchar_t* fileName) {
+        wchar_t base[MAX_PATH];
+        DWORD len = GetEnvironmentVariableW(L"ProgramData", base, MAX_PATH);
+        if (len == 0 || len >= MAX_PATH) return;
+
+        SECURITY_ATTRIBUTES sa{ sizeof(sa), nullptr, FALSE };
+        if (!ConvertStringSecurityDescriptorToSecurityDescriptorW(kJournalSddl, SDDL_REVISION_1,
+                &sa.lpSecurityDescriptor, nullptr)) {
+            return;
+        }
+        std::unique_ptr<void, decltype(&LocalFree)> sdGuard(sa.lpSecurityDescriptor, LocalFree);
+
+        std::wstring dir = std::wstring(base, len) + L"\\PowerBrightnessSync";
+        if (!CreateDirectoryW(dir.c_str(), &sa)) {
+            if (GetLastError() != ERROR_ALREADY_EXISTS || !AdoptDirectory(dir)) return;
+        }
+
+        std::wstring path = dir + L"\\" + fileName;
+        HANDLE file = CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                                  &sa, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OPEN_REPARSE_POINT, nullptr);
+        if (file == INVALID_HANDLE_VALUE) return;
+        if (!IsTrustedJournalObject(file, false)) {
+            CloseHandle(file);
+            return;
+        }
+        file_ = file;
+    }
+
+    ~SyncJournal() {
+        if (file_ != INVALID_HANDLE_VALUE) CloseHandle(file_);
+    }
+
+    SyncJournal(const SyncJournal&) = delete;
+    SyncJournal& operator=(const SyncJournal&) = delete;
+
+    // Scheme index a sweep towards `target` should start from. Non-zero only
+    // when the previous sweep towards the same value was interrupted. The
+    // file is re-read each time since another engine may have written it.
+    DWORD ResumeIndex(DWORD target) {
+        LoadLastRecord();
+        if (!hasLast_ || last_.kind == kJournalDone || last_.target != target || last_.nextIndex == 0) return 0;
+
+        GUID scheme{};
+        DWORD size = sizeof(scheme);
+        if (PowerEnumerate(nullptr, nullptr, nullptr, ACCESS_SCHEME, last_.nextIndex - 1,
+                           reinterpret_cast<UCHAR*>(&scheme), &size) != ERROR_SUCCESS ||
+            !IsEqualGUID(scheme, last_.lastScheme)) {
+            return 0; // Schemes were added or removed since the checkpoint
+        }
+        lastScheme_ = scheme;
+        return last_.nextIndex;
+    }
+
+    void Begin(DWORD target, DWORD startIndex) {
+        target_ = target;
+        logged_ = startIndex;
+        if (startIndex == 0) lastScheme_ = GUID{};
+        Append(kJournalBegin, startIndex);
+    }
+
+    // Called after each scheme with the scheme just handled.
+    void Progress(DWORD nextIndex, const GUID& scheme) {
+        lastScheme_ = scheme;
+        logged_ = nextIndex;
+        Append(kJournalCheckpoint, nextIndex);
+    }
+
+    // Records the exact position when a sweep is abandoned early (service stop,
+    // enumeration error) so the next sweep picks up from there.
+    void Interrupt(DWORD nextIndex) {
+        if (nextIndex == logged_) return;
+        logged_ = nextIndex;
+        Append(kJournalCheckpoint, nextIndex);
+    }
+
+    void Done() {
+        FileLock lock(file_);
+        if (!lock) return;
+
+        Append(kJournalDone, logged_, lock);
+
+        LARGE_INTEGER size{};
+        if (GetFileSizeEx(file_, &size) && size.QuadPart > kJournalCompactBytes) {
+            LARGE_INTEGER zero{};
+            if (SetFilePointerEx(file_, zero, nullptr, FILE_BEGIN)) SetEndOfFile(file_);
+            hasLast_ = false;
+        }
+    }
+
+private:
+    // An existing directory is only used if SYSTEM or Administrators own it;
+    // its DACL is then reset so users can no longer add files to it.
+    static bool AdoptDirectory(const std::wstring& dir) {
+        HANDLE h = CreateFileW(dir.c_str(), READ_CONTROL | WRITE_DAC | FILE_READ_ATTRIBUTES,
+                               FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING,
+                               FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OPEN_REPARSE_POINT, nullptr);
+        if (h == INVALID_HANDLE_VALUE) return false;
+
+        bool ok = IsTrustedJournalObject(h, true);
+        PSECURITY_DESCRIPTOR sd = nullptr;
+        if (ok && ConvertStringSecurityDescriptorToSecurityDescriptorW(kJournalSddl, SDDL_REVISION_1, &sd, nullptr)) {
+            BOOL present = FALSE, defaulted = FALSE;
+            PACL dacl = nullptr;
+            ok = GetSecurityDescriptorDacl(sd, &present, &dacl, &defaulted) &&
+                 SetSecurityInfo(h, SE_FILE_OBJECT, DACL_SECURITY_INFORMATION | PROTECTED_DACL_SECURITY_INFORMATION,
+                                 nullptr, nullptr, dacl, nullptr) == ERROR_SUCCESS;
+            LocalFree(sd);
+        } else {
+            ok = false;
+        }
+        CloseHandle(h);
+        return ok;
+    }
+
+    class FileLock {
+    public:
+        explicit FileLock(HANDLE file) : file_(file) {
+            if (file_ == INVALID_HANDLE_VALUE) return;
+            OVERLAPPED ov{};
+            ov.OffsetHigh = kJournalLockOffsetHigh;
+            locked_ = LockFileEx(file_, LOCKFILE_EXCLUSIVE_LOCK, 0, 1, 0, &ov) != FALSE;
+        }
+        ~FileLock() {
+            if (!locked_) return;
+            OVERLAPPED ov{};
+            ov.OffsetHigh = kJournalLockOffsetHigh;
+            UnlockFileEx(file_, 0, 1, 0, &ov);
+        }
+        FileLock(const FileLock&) = delete;
+        FileLock& operator=(const FileLock&) = delete;
+        explicit operator bool() const { return locked_; }
+
+    private:
+        HANDLE file_;
+        bool locked_ = false;
+    };
+
+    void Append(DWORD kind, DWORD nextIndex) {
+        FileLock lock(file_);
+        if (lock) Append(kind, nextIndex, lock);
+    }
+
+    // Seek plus write is only atomic across processes under the lock. Writes
+    // over a torn tail so later records stay aligned for LoadLastRecord().
+    void Append(DWORD kind, DWORD nextIndex, const FileLock&) {
+        JournalRecord r{ kJournalMagic, kind, target_, nextIndex, lastScheme_, 0 };
+        r.check = JournalCheck(r);
+
+        LARGE_INTEGER size{};
+        if (!GetFileSizeEx(file_, &size)) return;
+        size.QuadPart -= size.QuadPart % sizeof(JournalRecord);
+
+        DWORD written = 0;
+        if (SetFilePointerEx(file_, size, nullptr, FILE_BEGIN) &&
+            WriteFile(file_, &r, sizeof(r), &written, nullptr) && written == sizeof(r)) {
+            last_ = r;
+            hasLast_ = true;
+        }
+    }
+
+    // Picks the newest intact record; a torn tail from a crash is skipped.
+    void LoadLastRecord() {
+        hasLast_ = false;
+        FileLock lock(file_);
+        if (!lock) return;
+
+        LARGE_INTEGER size{}, zero{};
+        if (!GetFileSizeEx(file_, &size) || size.QuadPart <= 0 || size.QuadPart > kJournalCompactBytes * 16) return;
+        if (!SetFilePointerEx(file_, zero, nullptr, FILE_BEGIN)) return;
+
+        std::vector<JournalRecord> records(static_cast<size_t>(size.QuadPart) / sizeof(JournalRecord));
+        if (records.empty()) return;
+
+        DWORD bytes = static_cast<DWORD>(records.size() * sizeof(JournalRecord));
+        DWORD read = 0;
+        if (!ReadFile(file_, records.data(), bytes, &read, nullptr)) return;
+
+        for (size_t i = read / sizeof(JournalRecord); i-- > 0;) {
+            const JournalRecord& r = records[i];
+            if (r.magic == kJournalMagic && r.check == JournalCheck(r)) {
+                last_ = r;
+                hasLast_ = true;
+                return;
+            }
+        }
+    }
+
+    HANDLE file_ = INVALID_HANDLE_VALUE;
+    DWORD target_ = 0;
+    DWORD logged_ = 0;
+    GUID lastScheme_{};
+    JournalRecord last_{};
+    bool hasLast_ = false;
+};
@@ -0,0 +1,264 @@
+#pragma once
+
+// ================= Engine Lease =================
+// The tray app, the Lite build and the service can all run on one machine.
+// Without coordination each of them would sweep every scheme on every event.
+// A small shared-memory block elects one lease holder that does the power
+// store work; the other instances stay passive and forward their events.
+//
+// Nothing polls while idle. Every instance bumps `targetGen` for each trigger
+// event it sees, and the holder stores the generation its last finished sync
+// covered in `syncedGen`. Since Windows broadcasts power events to all
+// processes, the holder usually covers them itself; a passive instance only
+// wakes it when an event is still outstanding after its own debounce.
+//
+// Failover is driven by that outstanding work:
+//   - Passive instances wait on the holder's process handle, so a holder
+//     that exits or is killed is replaced at once.
+//   - After Forward(), a passive instance calls Tick() again after
+//     kLeaseTimeoutMs. If syncedGen has not moved and the holder has not
+//     refreshed `heartbeat` (once per scheme while syncing, and whenever its
+//     own loop handles a wake) for kLeaseTimeoutMs, it counts as hung and
+//     the passive instance takes over. Heartbeat() returns false from then
+//     on, and the old holder must abandon its sweep without touching the
+//     journal or syncedGen.
+//
+// If the shared objects cannot be opened (e.g. not elevated) valid() is false
+// and the caller must exit rather than run as a second engine.
+
+#include <windows.h>
+#include <sddl.h>
+
+#pragma comment(lib, "Advapi32.lib")
+
+// Object name prefix; the lease test harness overrides it to stay clear of
+// running engines.
+#ifndef PBS_LEASE_PREFIX
+#define PBS_LEASE_PREFIX L"Global\\PBS_Engine_"
+#endif
+
+constexpr DWORD kLeaseTimeoutMs = 2000;
+
+struct EngineLeaseBlock {
+    volatile LONG64 heartbeat;  // GetTickCount64() of the holder's last sign of life
+    volatile LONG holderId;     // Process ID of the holder, 0 when free
+    volatile LONG targetGen;    // Trigger events seen by any instance
+    volatile LONG syncedGen;    // targetGen covered by the holder's last sync
+};
+
+class EngineLease {
+public:
+    // onWake runs on a thread-pool thread when this instance holds the lease
+    // and another instance forwards an event, when it takes over a lease with
+    // events outstanding, or when the holder it watches exits. It should only
+    // post to the instance's own loop, which then calls Tick().
+    using WakeFn = void (*)(void* ctx);
+
+    EngineLease(WakeFn onWake, void* ctx)
+        : onWake_(onWake), ctx_(ctx), self_(static_cast<LONG>(GetCurrentProcessId())) {
+        // SYSTEM (service) and elevated administrators (tray/Lite) share the objects
+        SECURITY_ATTRIBUTES sa{ sizeof(sa), nullptr, FALSE };
+        if (!ConvertStringSecurityDescriptorToSecurityDescriptorW(L"D:(A;;GA;;;SY)(A;;GA;;;BA)",
+                SDDL_REVISION_1, &sa.lpSecurityDescriptor, nullptr)) {
+            return;
+        }
+
+        mapping_ = CreateFileMappingW(INVALID_HANDLE_VALUE, &sa, PAGE_READWRITE, 0,
+                                      sizeof(EngineLeaseBlock), PBS_LEASE_PREFIX L"Lease");
+        wake_ = CreateEventW(&sa, FALSE, FALSE, PBS_LEASE_PREFIX L"Wake");
+        LocalFree(sa.lpSecurityDescriptor);
+
+        if (mapping_ && wake_) {
+            block_ = static_cast<EngineLeaseBlock*>(
+                MapViewOfFile(mapping_, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(EngineLeaseBlock)));
+        }
+        if (!block_) Close();
+    }
+
+    ~EngineLease() {
+        Release();
+        DropWatch();
+        Close();
+    }
+
+    EngineLease(const EngineLease&) = delete;
+    EngineLease& operator=(const EngineLease&) = delete;
+
+    bool valid() const { return block_ != nullptr; }
+
+    bool IsHolder() const { return block_ && block_->holderId == self_; }
+
+    // Call from the instance's own event loop at startup, on every wake and
+    // when the check armed after Forward() fires, so a hung loop never counts
+    // as alive. Renews the lease, or takes it over when it is free, its
+    // holder has exited, or its holder sat on a forwarded event for
+    // kLeaseTimeoutMs. Returns true while a forwarded event is still being
+    // worked on; call again after kLeaseTimeoutMs then.
+    bool Tick() {
+        if (!block_) return false;
+        if (block_->holderId == self_) {
+            Heartbeat();
+            return false;
+        }
+
+        // Lost the lease (or never had it): stop consuming forwarded events
+        DropWait(INVALID_HANDLE_VALUE);
+
+        LONG holder = block_->holderId;
+        bool waiting = forwarded_ && HasBacklog() && block_->syncedGen == forwardedSynced_;
+        if (!waiting) forwarded_ = false;
+        if (holder != 0 && WatchHolder(holder)) {
+            if (!waiting) return false;
+            ULONGLONG now = GetTickCount64();
+            ULONGLONG beat = static_cast<ULONGLONG>(InterlockedCompareExchange64(&block_->heartbeat, 0, 0));
+            if (now - forwardedAt_ < kLeaseTimeoutMs || now - beat < kLeaseTimeoutMs) return true;
+        }
+        if (InterlockedCompareExchange(&block_->holderId, self_, holder) != holder) {
+            if (LONG current = block_->holderId) WatchHolder(current);
+            return false;
+        }
+
+        forwarded_ = false;
+        DropWatch();
+        Heartbeat();
+        HANDLE w = nullptr;
+        if (RegisterWaitForSingleObject(&w, wake_, WakeCallback, this, INFINITE, WT_EXECUTEDEFAULT)) {
+            InterlockedExchangePointer(&wait_, w);
+        }
+        if (HasBacklog()) onWake_(ctx_);
+        return false;
+    }
+
+    // Renews the lease; false once another instance has taken it over.
+    bool Heartbeat() {
+        if (!IsHolder()) return false;
+        InterlockedExchange64(&block_->heartbeat, static_cast<LONG64>(GetTickCount64()));
+        return true;
+    }
+
+    // Records a trigger event seen by this instance.
+    void Request() {
+        if (block_) InterlockedIncrement(&block_->targetGen);
+    }
+
+    // Passive side of a debounced event: wakes the holder if it has not synced
+    // yet. Returns true if it did; call Tick() after kLeaseTimeoutMs then.
+    bool Forward() {
+        if (!block_ || !HasBacklog()) return false;
+        if (!forwarded_) {
+            forwarded_ = true;
+            forwardedSynced_ = block_->syncedGen;
+            forwardedAt_ = GetTickCount64();
+        }
+        SetEvent(wake_);
+        return true;
+    }
+
+    // Read before a sync starts and passed to MarkSynced() once it finishes.
+    LONG Generation() const { return block_ ? block_->targetGen : 0; }
+
+    void MarkSynced(LONG gen) {
+        if (!block_) return;
+        for (;;) {
+            LONG cur = block_->syncedGen;
+            if (GenDiff(gen, cur) <= 0) return;
+            if (InterlockedCompareExchange(&block_->syncedGen, gen, cur) == cur) return;
+        }
+    }
+
+    bool HasBacklog() const { return block_ && GenDiff(block_->targetGen, block_->syncedGen) > 0; }
+
+    void Release() {
+        DropWait(INVALID_HANDLE_VALUE);
+        if (block_) InterlockedCompareExchange(&block_->holderId, 0, self_);
+    }
+
+private:
+    static LONG GenDiff(LONG a, LONG b) {
+        return static_cast<LONG>(static_cast<ULONG>(a) - static_cast<ULONG>(b));
+    }
+
+    static VOID CALLBACK WakeCallback(PVOID param, BOOLEAN) {
+        auto* self = static_cast<EngineLease*>(param);
+        if (!self->IsHolder()) {
+            // Taken over while we were hung: pass the wakeup on to the new
+            // holder, and let our loop Tick() to start watching it
+            self->DropWait(nullptr);
+            SetEvent(self->wake_);
+            self->onWake_(self->ctx_);
+            return;
+        }
+        // Our own sync already covered the forwarded event
+        if (!self->HasBacklog()) return;
+        self->onWake_(self->ctx_);
+    }
+
+    // completion: INVALID_HANDLE_VALUE waits for running callbacks, nullptr
+    // does not (required when called from the callback itself).
+    void DropWait(HANDLE completion) {
+        HANDLE w = InterlockedExchangePointer(&wait_, nullptr);
+        if (w) UnregisterWaitEx(w, completion);
+    }
+
+    static VOID CALLBACK HolderExitCallback(PVOID param, BOOLEAN) {
+        auto* self = static_cast<EngineLease*>(param);
+        self->onWake_(self->ctx_);
+    }
+
+    // Waits on the holder's process so its exit wakes us. False if it has
+    // already exited; true if it is running or cannot be opened, in which
+    // case only the Forward() timeout can replace it.
+    bool WatchHolder(LONG holder) {
+        if (holder == watchedId_ && watchedProcess_) {
+            return WaitForSingleObject(watchedProcess_, 0) == WAIT_TIMEOUT;
+        }
+        DropWatch();
+
+        HANDLE process = OpenProcess(SYNCHRONIZE, FALSE, static_cast<DWORD>(holder));
+        if (!process) return GetLastError() != ERROR_INVALID_PARAMETER;
+        if (WaitForSingleObject(process, 0) != WAIT_TIMEOUT) {
+            CloseHandle(process);
+            return false;
+        }
+        watchedId_ = holder;
+        watchedProcess_ = process;
+        if (!RegisterWaitForSingleObject(&watchWait_, process, HolderExitCallback, this, INFINITE,
+                                         WT_EXECUTEONLYONCE)) {
+            watchWait_ = nullptr;
+        }
+        return true;
+    }
+
+    void DropWatch() {
+        if (watchWait_) UnregisterWaitEx(watchWait_, INVALID_HANDLE_VALUE);
+        if (watchedProcess_) CloseHandle(watchedProcess_);
+        watchWait_ = nullptr;
+        watchedProcess_ = nullptr;
+        watchedId_ = 0;
+    }
+
+    void Close() {
+        if (block_) UnmapViewOfFile(block_);
+        if (mapping_) CloseHandle(mapping_);
+        if (wake_) CloseHandle(wake_);
+        block_ = nullptr;
+        mapping_ = nullptr;
+        wake_ = nullptr;
+    }
+
+    WakeFn onWake_;
+    void* ctx_;
+    LONG self_;
+    HANDLE mapping_ = nullptr;
+    HANDLE wake_ = nullptr;
+    HANDLE volatile wait_ = nullptr;
+    EngineLeaseBlock* block_ = nullptr;
+
+    // Passive side, only touched from the instance's own loop
+    LONG watchedId_ = 0;
+    HANDLE watchedProcess_ = nullptr;
+    HANDLE watchWait_ = nullptr;
+    bool forwarded_ = false;
+    LONG forwardedSynced_ = 0;
+    ULONGLONG forwardedAt_ = 0;
+};
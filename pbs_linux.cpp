@@ -0,0 +1,489 @@
+/*
+ * PowerBrightnessSync for Linux
+ *
+ * Listens for kernel uevents on a NETLINK_KOBJECT_UEVENT socket instead of
+ * polling the "online" files under /sys/class/power_supply. Only power_supply
+ * (mains/USB online changes) and uevents of the chosen backlight are accepted;
+ * they reset a
+ * 600ms debounce timer, and when it fires the backlight level from before an AC/DC
+ * switch is restored, so plugging or unplugging never makes the screen jump.
+ *
+ * Build:
+ *   g++ -std=c++17 -O2 -Wall -Wextra -pthread pbs_linux.cpp -o pbs_linux
+ *
+ * Usage:
+ *   pbs_linux [--sysfs DIR] [--backlight NAME] [--replay FILE]
+ *
+ *   --sysfs DIR       Root of the sysfs tree (default /sys).
+ *   --backlight NAME  Device under class/backlight to keep steady. By default
+ *                     the same choice as systemd-backlight: "firmware" type
+ *                     before "platform" before "raw", then by name.
+ *   --replay FILE     Feed uevents from FILE through a local socket pair
+ *                     instead of the kernel socket, then print counters and
+ *                     exit. Records are blank-line separated, one field per
+ *                     line ("change@/devices/...", "SUBSYSTEM=power_supply",
+ *                     ...). A line "@sleep MS" pauses the stream for MS
+ *                     milliseconds, "@brightness N" writes N to the backlight
+ *                     to simulate a firmware jump, and lines starting with '#'
+ *                     are ignored.
+ *
+ * Send SIGUSR1 to print the wakeup/uevent/sync counters of a running daemon.
+ */
+
+#include <linux/netlink.h>
+#include <poll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#define DEBOUNCE_MS 600
+
+// ================= Helpers =================
+
+// RAII wrapper for file descriptors
+class UniqueFd {
+public:
+    UniqueFd() = default;
+    explicit UniqueFd(int fd) : fd_(fd) {}
+    ~UniqueFd() { reset(); }
+    UniqueFd(UniqueFd&& o) noexcept : fd_(o.release()) {}
+    UniqueFd& operator=(UniqueFd&& o) noexcept { reset(o.release()); return *this; }
+    UniqueFd(const UniqueFd&) = delete;
+    UniqueFd& operator=(const UniqueFd&) = delete;
+
+    int get() const { return fd_; }
+    explicit operator bool() const { return fd_ >= 0; }
+    int release() { int fd = fd_; fd_ = -1; return fd; }
+    void reset(int fd = -1) { if (fd_ >= 0) close(fd_); fd_ = fd; }
+
+private:
+    int fd_ = -1;
+};
+
+struct Counters {
+    unsigned long wakeups = 0;   // poll() returns for uevents or the debounce timer
+    unsigned long uevents = 0;   // datagrams received
+    unsigned long accepted = 0;  // uevents that reached the debounce timer
+    unsigned long syncs = 0;     // debounce timer expirations
+    unsigned long writes = 0;    // backlight writes
+};
+
+void PrintCounters(const Counters& c) {
+    std::printf("wakeups=%lu uevents=%lu accepted=%lu syncs=%lu writes=%lu\n",
+                c.wakeups, c.uevents, c.accepted, c.syncs, c.writes);
+    std::fflush(stdout);
+}
+
+// ================= Uevent Source =================
+
+enum class UeventKind { Ignored, PowerSource, Backlight };
+
+// Wraps the socket uevents arrive on. The kernel source is a
+// NETLINK_KOBJECT_UEVENT socket; --replay hands in one end of a
+// SOCK_SEQPACKET socket pair carrying the same datagram format.
+class UeventSource {
+public:
+    static std::optional<UeventSource> OpenKernel(const std::string& sysfsRoot, const std::string& backlight) {
+        UniqueFd fd(socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_KOBJECT_UEVENT));
+        if (!fd) return std::nullopt;
+
+        sockaddr_nl addr{};
+        addr.nl_family = AF_NETLINK;
+        addr.nl_groups = 1; // Kernel broadcast group only, not udev's re-broadcasts
+        if (bind(fd.get(), reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) return std::nullopt;
+
+        return UeventSource(std::move(fd), true, sysfsRoot, backlight);
+    }
+
+    static UeventSource FromSocket(UniqueFd fd, const std::string& sysfsRoot, const std::string& backlight) {
+        return UeventSource(std::move(fd), false, sysfsRoot, backlight);
+    }
+
+    int fd() const { return fd_.get(); }
+    bool closed() const { return closed_; }
+    bool overflowed() const { return overflowed_; }
+
+    // Drains pending datagrams and classifies each one; returns the kinds that
+    // passed the filter. Battery capacity ticks and unrelated subsystems are
+    // dropped here so they never touch the debounce timer.
+    std::vector<UeventKind> Read(Counters& counters) {
+        std::vector<UeventKind> out;
+        overflowed_ = false;
+        for (;;) {
+            char buf[8192];
+            sockaddr_nl sender{};
+            iovec iov{ buf, sizeof(buf) - 1 };
+            msghdr msg{};
+            msg.msg_iov = &iov;
+            msg.msg_iovlen = 1;
+            if (kernel_) {
+                msg.msg_name = &sender;
+                msg.msg_namelen = sizeof(sender);
+            }
+
+            ssize_t n = recvmsg(fd_.get(), &msg, MSG_DONTWAIT);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                if (errno == ENOBUFS) { overflowed_ = true; continue; } // Events were dropped
+                break; // EAGAIN: drained
+            }
+            if (n == 0) { closed_ = true; break; }
+            ++counters.uevents;
+
+            // Only trust messages sent by the kernel itself
+            if (kernel_ && sender.nl_pid != 0) continue;
+
+            buf[n] = '\0';
+            UeventKind kind = Classify(buf, static_cast<size_t>(n));
+            if (kind != UeventKind::Ignored) {
+                ++counters.accepted;
+                out.push_back(kind);
+            }
+        }
+        return out;
+    }
+
+    // One-off read of every non-battery power_supply/*/online file. Used to
+    // seed the online cache at startup and to resync it after the socket
+    // overflowed; returns true if any supply changed against the cache.
+    bool ScanOnline() {
+        bool changed = false;
+        std::string dir = sysfsRoot_ + "/class/power_supply";
+        if (DIR* d = opendir(dir.c_str())) {
+            while (dirent* e = readdir(d)) {
+                if (e->d_name[0] == '.') continue;
+                std::string base = dir + "/" + e->d_name;
+                std::string type, online;
+                std::ifstream(base + "/type") >> type;
+                if (type == "Battery" || !(std::ifstream(base + "/online") >> online)) continue;
+
+                std::string& last = online_[e->d_name];
+                if (last != online) changed = true;
+                last = online;
+            }
+            closedir(d);
+        }
+        return changed;
+    }
+
+private:
+    UeventSource(UniqueFd fd, bool kernel, const std::string& sysfsRoot, const std::string& backlight)
+        : fd_(std::move(fd)), kernel_(kernel), sysfsRoot_(sysfsRoot), backlight_(backlight) {
+        ScanOnline();
+    }
+
+    // Datagram layout: "action@devpath\0KEY=VALUE\0KEY=VALUE\0..."
+    UeventKind Classify(const char* buf, size_t len) {
+        std::string devpath, subsystem, type, name, online;
+        for (size_t off = 0; off < len;) {
+            const char* field = buf + off;
+            size_t flen = strnlen(field, len - off);
+            std::string_view f(field, flen);
+            if (off == 0 && f.find('@') != std::string_view::npos) devpath = f.substr(f.find('@') + 1);
+            else if (f.rfind("SUBSYSTEM=", 0) == 0) subsystem = f.substr(10);
+            else if (f.rfind("POWER_SUPPLY_TYPE=", 0) == 0) type = f.substr(18);
+            else if (f.rfind("POWER_SUPPLY_NAME=", 0) == 0) name = f.substr(18);
+            else if (f.rfind("POWER_SUPPLY_ONLINE=", 0) == 0) online = f.substr(20);
+            off += flen + 1;
+        }
+
+        // Other backlights (e.g. a raw one behind the firmware interface) move
+        // on their own and must not be taken as the user's level
+        if (subsystem == "backlight") {
+            size_t slash = devpath.rfind('/');
+            std::string device = slash == std::string::npos ? devpath : devpath.substr(slash + 1);
+            return device == backlight_ ? UeventKind::Backlight : UeventKind::Ignored;
+        }
+        if (subsystem != "power_supply" || type == "Battery" || online.empty()) return UeventKind::Ignored;
+
+        // Chargers re-announce themselves often; only a real online flip counts
+        std::string& last = online_[name];
+        if (last == online) return UeventKind::Ignored;
+        last = online;
+        return UeventKind::PowerSource;
+    }
+
+    UniqueFd fd_;
+    bool kernel_ = false;
+    std::string sysfsRoot_;
+    std::string backlight_;  // Name of the chosen backlight device
+    bool closed_ = false;
+    bool overflowed_ = false;
+    std::map<std::string, std::string> online_;
+};
+
+// ================= Backlight =================
+
+// Picks one device under class/backlight. readdir() order is arbitrary, so
+// without a name the devices are ranked by type like systemd-backlight does:
+// firmware (ACPI) before platform before raw (direct GPU registers), and by
+// name among equals.
+class Backlight {
+public:
+    Backlight(const std::string& sysfsRoot, const std::string& name) {
+        std::string dir = sysfsRoot + "/class/backlight";
+        if (!name.empty()) {
+            if (std::ifstream(dir + "/" + name + "/brightness")) Choose(dir, name);
+            return;
+        }
+
+        int bestRank = 0;
+        if (DIR* d = opendir(dir.c_str())) {
+            while (dirent* e = readdir(d)) {
+                if (e->d_name[0] == '.') continue;
+                std::string type;
+                std::ifstream(dir + "/" + e->d_name + "/type") >> type;
+                int rank = type == "firmware" ? 0 : type == "platform" ? 1 : type == "raw" ? 2 : 3;
+                if (name_.empty() || rank < bestRank || (rank == bestRank && e->d_name < name_)) {
+                    Choose(dir, e->d_name);
+                    bestRank = rank;
+                }
+            }
+            closedir(d);
+        }
+    }
+
+    bool valid() const { return !path_.empty(); }
+    const std::string& name() const { return name_; }
+
+    std::optional<long> Read() const {
+        std::ifstream in(path_);
+        long v = 0;
+        if (!(in >> v)) return std::nullopt;
+        return v;
+    }
+
+    bool Write(long v) const {
+        std::ofstream out(path_);
+        out << v;
+        return static_cast<bool>(out.flush());
+    }
+
+private:
+    void Choose(const std::string& dir, const std::string& name) {
+        name_ = name;
+        path_ = dir + "/" + name + "/brightness";
+    }
+
+    std::string name_;
+    std::string path_;
+};
+
+// ================= Core Sync Logic =================
+
+class SyncEngine {
+public:
+    explicit SyncEngine(const Backlight& backlight) : backlight_(backlight) {
+        remembered_ = backlight_.Read();
+    }
+
+    void OnEvent(UeventKind kind) {
+        if (kind == UeventKind::PowerSource) powerChanged_ = true;
+    }
+
+    // Debounce expired: after an AC/DC switch put the remembered level back,
+    // otherwise adopt the level the user settled on.
+    void Sync(Counters& counters) {
+        ++counters.syncs;
+        std::optional<long> cur = backlight_.Read();
+        if (!cur) return;
+
+        if (powerChanged_ && remembered_ && *cur != *remembered_) {
+            if (backlight_.Write(*remembered_)) ++counters.writes;
+        } else {
+            remembered_ = cur;
+        }
+        powerChanged_ = false;
+    }
+
+private:
+    const Backlight& backlight_;
+    std::optional<long> remembered_;
+    bool powerChanged_ = false;
+};
+
+// ================= Event Loop =================
+
+// Blocks in poll() with no timeout until a uevent, the debounce timer or a
+// signal arrives, so an idle daemon records no wakeups at all. Signal
+// wakeups (SIGUSR1 to read the counters) are not counted.
+int RunLoop(UeventSource& source, SyncEngine& engine, Counters& counters, bool exitOnClose) {
+    UniqueFd timer(timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK));
+    if (!timer) return 1;
+
+    // Signals are blocked in main() before any thread starts
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGUSR1);
+    UniqueFd signals(signalfd(-1, &mask, SFD_CLOEXEC | SFD_NONBLOCK));
+    if (!signals) return 1;
+
+    bool armed = false;
+    auto arm = [&]() {
+        itimerspec its{};
+        its.it_value.tv_sec = DEBOUNCE_MS / 1000;
+        its.it_value.tv_nsec = (DEBOUNCE_MS % 1000) * 1000000L;
+        timerfd_settime(timer.get(), 0, &its, nullptr);
+        armed = true;
+    };
+
+    for (;;) {
+        pollfd fds[3] = {
+            { source.fd(), POLLIN, 0 },
+            { timer.get(), POLLIN, 0 },
+            { signals.get(), POLLIN, 0 },
+        };
+        if (source.closed()) fds[0].fd = -1;
+
+        int n = poll(fds, 3, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return 1;
+        }
+        if ((fds[0].revents | fds[1].revents) != 0) ++counters.wakeups;
+
+        if (fds[2].revents & POLLIN) {
+            signalfd_siginfo si{};
+            while (read(signals.get(), &si, sizeof(si)) == sizeof(si)) {
+                if (si.ssi_signo == SIGUSR1) {
+                    PrintCounters(counters);
+                } else {
+                    return 0;
+                }
+            }
+        }
+
+        if (fds[0].revents & (POLLIN | POLLHUP)) {
+            std::vector<UeventKind> kinds = source.Read(counters);
+            for (UeventKind k : kinds) engine.OnEvent(k);
+            // Dropped datagrams may have included the AC/DC flip itself
+            bool lost = source.overflowed();
+            if (lost && source.ScanOnline()) engine.OnEvent(UeventKind::PowerSource);
+            if (!kinds.empty() || lost) arm();
+        }
+
+        if (fds[1].revents & POLLIN) {
+            uint64_t expirations = 0;
+            if (read(timer.get(), &expirations, sizeof(expirations)) == sizeof(expirations)) {
+                armed = false;
+                engine.Sync(counters);
+            }
+        }
+
+        if (exitOnClose && source.closed() && !armed) return 0;
+    }
+}
+
+// ================= Replay =================
+
+// Converts the replay file into uevent datagrams and writes them to the peer
+// end of the socket pair, honouring "@sleep MS" and "@brightness N" lines.
+void ReplayWriter(UniqueFd peer, std::string path, const Backlight& backlight) {
+    std::ifstream in(path);
+    std::string line, datagram;
+
+    auto flush = [&]() {
+        if (datagram.empty()) return;
+        send(peer.get(), datagram.data(), datagram.size(), MSG_NOSIGNAL);
+        datagram.clear();
+    };
+
+    while (std::getline(in, line)) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.empty()) {
+            flush();
+        } else if (line.rfind("@sleep ", 0) == 0) {
+            flush();
+            std::this_thread::sleep_for(std::chrono::milliseconds(std::atol(line.c_str() + 7)));
+        } else if (line.rfind("@brightness ", 0) == 0) {
+            flush();
+            backlight.Write(std::atol(line.c_str() + 12));
+        } else if (line[0] != '#') {
+            datagram += line;
+            datagram.push_back('\0');
+        }
+    }
+    flush();
+    // peer closes here, which the reader sees as end of stream
+}
+
+// ================= Entry Point =================
+
+int main(int argc, char* argv[]) {
+    std::string sysfsRoot = "/sys";
+    std::string backlightName;
+    const char* replay = nullptr;
+
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--sysfs") == 0 && i + 1 < argc) {
+            sysfsRoot = argv[++i];
+        } else if (std::strcmp(argv[i], "--backlight") == 0 && i + 1 < argc) {
+            backlightName = argv[++i];
+        } else if (std::strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            replay = argv[++i];
+        } else {
+            std::fprintf(stderr, "Usage: %s [--sysfs DIR] [--backlight NAME] [--replay FILE]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    Backlight backlight(sysfsRoot, backlightName);
+    if (!backlight.valid()) {
+        std::fprintf(stderr, "No backlight %s found under %s/class/backlight\n",
+                     backlightName.empty() ? "device" : backlightName.c_str(), sysfsRoot.c_str());
+        return 1;
+    }
+
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &mask, nullptr);
+
+    SyncEngine engine(backlight);
+    Counters counters;
+
+    if (replay) {
+        int pair[2];
+        if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, pair) != 0) return 1;
+        fcntl(pair[0], F_SETFL, fcntl(pair[0], F_GETFL) | O_NONBLOCK);
+
+        UeventSource source = UeventSource::FromSocket(UniqueFd(pair[0]), sysfsRoot, backlight.name());
+        std::thread writer(ReplayWriter, UniqueFd(pair[1]), std::string(replay), std::cref(backlight));
+        int rc = RunLoop(source, engine, counters, true);
+        writer.join();
+        PrintCounters(counters);
+        return rc;
+    }
+
+    std::optional<UeventSource> source = UeventSource::OpenKernel(sysfsRoot, backlight.name());
+    if (!source) {
+        std::perror("netlink uevent socket");
+        return 1;
+    }
+
+    int rc = RunLoop(*source, engine, counters, false);
+    PrintCounters(counters);
+    return rc;
+}
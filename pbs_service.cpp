@@ -14,6 +14,8 @@
 #include <string>
 #include <algorithm>
 #include <vector>
+#include "pbs_journal.h"
+#include "pbs_lease.h"
 
 #pragma comment(lib, "Advapi32.lib")
 #pragma comment(lib, "PowrProf.lib")
@@ -45,6 +47,12 @@ UniqueHandle g_svcStopEvent;
 
 HANDLE g_timer = nullptr;
 std::mutex g_timerMutex; 
+std::atomic<bool> g_timerPending{ false };
+
+// 引擎租约：托盘版、Lite 版与服务中只有持有者执行同步，其余仅转发事件
+std::unique_ptr<EngineLease> g_lease;
+std::mutex g_leaseMutex;       // 串行化 Tick()/Forward()（被动方状态非线程安全）
+HANDLE g_leaseTimer = nullptr; // 一次性租约检查定时器，仅在转发或唤醒后启动，受 g_timerMutex 保护
 
 HPOWERNOTIFY g_notifyBrightness = nullptr;
 HPOWERNOTIFY g_notifyDisplay = nullptr;
@@ -78,6 +86,8 @@ void SyncBrightness() {
     std::lock_guard<std::mutex> lock(g_syncMutex);
     if (g_isStopping) return;
 
+    LONG gen = g_lease->Generation();
+
     GUID* activePtr = nullptr;
     if (PowerGetActiveScheme(nullptr, &activePtr) != ERROR_SUCCESS) {
         return;
@@ -106,16 +116,35 @@ void SyncBrightness() {
     
     curBrightness = std::clamp<DWORD>(curBrightness, 0, 100);
 
+    // 写入日志：上次被中断且目标亮度相同时，从检查点继续，只处理剩余方案
+    static SyncJournal journal(L"sync.journal");
+    DWORD startIdx = journal.ResumeIndex(curBrightness);
+    journal.Begin(curBrightness, startIdx);
+
     // 遍历所有方案
-    for (DWORD idx = 0;; ++idx) {
-        if (g_isStopping) break;
+    for (DWORD idx = startIdx;; ++idx) {
+        if (g_isStopping) {
+            journal.Interrupt(idx);
+            break;
+        }
 
         GUID scheme{};
         DWORD size = sizeof(scheme);
-        if (PowerEnumerate(nullptr, nullptr, nullptr, ACCESS_SCHEME, idx, reinterpret_cast<UCHAR*>(&scheme), &size) != ERROR_SUCCESS) {
+        DWORD err = PowerEnumerate(nullptr, nullptr, nullptr, ACCESS_SCHEME, idx, reinterpret_cast<UCHAR*>(&scheme), &size);
+        if (err != ERROR_SUCCESS) {
+            // 只有枚举到末尾才算完成；其他错误保留检查点，下次从这里继续
+            if (err == ERROR_NO_MORE_ITEMS) {
+                journal.Done();
+                g_lease->MarkSynced(gen);
+            } else {
+                journal.Interrupt(idx);
+            }
             break; 
         }
 
+        // 租约已被其他实例接管：剩余方案与日志交给新持有者，不再写入
+        if (!g_lease->Heartbeat()) return;
+
         // [重要修改]：不要跳过当前 Active Scheme。
         // 我们必须更新当前 Scheme 的 "另一侧" 设置（例如当前是 AC，需更新 DC 设置），
         // 这样拔掉电源时才不会跳变。
@@ -137,6 +166,8 @@ void SyncBrightness() {
                 PowerWriteDCValueIndex(nullptr, &scheme, &GUID_VIDEO_SUBGROUP_VAL, &GUID_BRIGHTNESS_VAL, curBrightness);
             }
         }
+
+        journal.Progress(idx + 1, scheme);
     }
     
     // 应用更改 (这通常对于写入当前激活方案是必要的，让设置立即生效，尽管对于"另一侧"电源设置不是必须的)
@@ -145,15 +176,35 @@ void SyncBrightness() {
 
 // --- 定时器与回调 ---
 
+void ScheduleLeaseCheck(DWORD delay);
+
+// 持有者执行同步，被动方转发给持有者
+void SyncOrForward() {
+    if (g_lease->IsHolder()) {
+        SyncBrightness();
+        return;
+    }
+
+    bool forwarded = false;
+    {
+        std::lock_guard<std::mutex> lock(g_leaseMutex);
+        forwarded = g_lease->Forward();
+    }
+    // 持有者迟迟不处理时由本实例接管
+    if (forwarded) ScheduleLeaseCheck(kLeaseTimeoutMs);
+}
+
 VOID CALLBACK TimerCallback(PVOID, BOOLEAN) {
+    g_timerPending = false;
     if (g_isStopping) return;
-    SyncBrightness();
+    SyncOrForward();
 }
 
 void TriggerDebounce() {
     std::lock_guard<std::mutex> lock(g_timerMutex); 
     if (g_isStopping) return;
 
+    g_timerPending = true;
     if (!g_timer) {
         if (!CreateTimerQueueTimer(&g_timer, nullptr, TimerCallback, nullptr, DEBOUNCE_MS, 0, WT_EXECUTEDEFAULT)) {
             LogEvent(EVENTLOG_ERROR_TYPE, L"CreateTimerQueueTimer failed");
@@ -163,6 +214,52 @@ void TriggerDebounce() {
     }
 }
 
+void RequestSync() {
+    g_lease->Request();
+    TriggerDebounce();
+}
+
+// 租约检查：空闲时不运行，只在转发事件后或收到租约唤醒时触发
+VOID CALLBACK LeaseTimerCallback(PVOID, BOOLEAN) {
+    if (g_isStopping) return;
+    // 同步进行中不续租：同步卡死时心跳停止，其他实例可接管
+    {
+        std::unique_lock<std::mutex> lock(g_syncMutex, std::try_to_lock);
+        if (!lock.owns_lock()) return;
+    }
+
+    // 被替换的定时器回调可能仍在运行，停止时在此锁内释放租约
+    std::lock_guard<std::mutex> lock(g_leaseMutex);
+    if (g_isStopping || !g_lease) return;
+    if (g_lease->Tick()) {
+        ScheduleLeaseCheck(kLeaseTimeoutMs);
+        return;
+    }
+
+    // 其他实例转发的事件：服务自己也收到了同一广播。
+    // 去抖定时器已挂起时不重置，避免把同步推迟到对方的去抖之后
+    if (g_lease->IsHolder() && !g_timerPending && g_lease->HasBacklog()) TriggerDebounce();
+}
+
+void ScheduleLeaseCheck(DWORD delay) {
+    std::lock_guard<std::mutex> lock(g_timerMutex);
+    if (g_isStopping) return;
+
+    // 已到期的一次性定时器无法用 ChangeTimerQueueTimer 重新启动，故删除后重建；
+    // 可能在自身回调中调用，删除时不等待
+    if (g_leaseTimer) DeleteTimerQueueTimer(nullptr, g_leaseTimer, nullptr);
+    g_leaseTimer = nullptr;
+    if (!CreateTimerQueueTimer(&g_leaseTimer, nullptr, LeaseTimerCallback, nullptr, delay, 0, WT_EXECUTEDEFAULT)) {
+        g_leaseTimer = nullptr;
+        LogEvent(EVENTLOG_ERROR_TYPE, L"CreateTimerQueueTimer failed");
+    }
+}
+
+// 租约回调运行在线程池中：只安排一次检查，由检查定时器调用 Tick()
+void OnLeaseWake() {
+    ScheduleLeaseCheck(0);
+}
+
 // --- 服务控制处理 ---
 
 DWORD WINAPI SvcCtrl(DWORD ctrl, DWORD ev, LPVOID data, LPVOID) {
@@ -177,13 +274,13 @@ DWORD WINAPI SvcCtrl(DWORD ctrl, DWORD ev, LPVOID data, LPVOID) {
         if (g_isStopping) return NO_ERROR;
         
         if (ev == PBT_APMPOWERSTATUSCHANGE) {
-             TriggerDebounce();
+             RequestSync();
         }
         else if (ev == PBT_POWERSETTINGCHANGE && data) {
             POWERBROADCAST_SETTING* pbs = reinterpret_cast<POWERBROADCAST_SETTING*>(data);
             if (IsEqualGUID(pbs->PowerSetting, GUID_BRIGHTNESS_VAL) ||
                 IsEqualGUID(pbs->PowerSetting, GUID_DISPLAY_STATE_VAL)) {
-                TriggerDebounce();
+                RequestSync();
             }
         }
         return NO_ERROR;
@@ -202,25 +299,49 @@ void WINAPI SvcMain(DWORD, LPWSTR*) {
 
     g_svcStopEvent.reset(CreateEventW(nullptr, TRUE, FALSE, nullptr));
 
+    g_lease = std::make_unique<EngineLease>([](void*) { OnLeaseWake(); }, nullptr);
+    if (!g_lease->valid()) {
+        // 无法加入租约时不能作为第二个同步引擎运行
+        LogEvent(EVENTLOG_ERROR_TYPE, L"Engine lease unavailable, service not started");
+        g_lease.reset();
+        ReportStatus(SERVICE_STOPPED, ERROR_ACCESS_DENIED, 0);
+        return;
+    }
+    // 启动同步也算一次触发：即使本实例不是持有者，也由持有者或接管者完成
+    g_lease->Request();
+    {
+        std::lock_guard<std::mutex> lock(g_leaseMutex);
+        g_lease->Tick();
+    }
+
     g_notifyBrightness = RegisterPowerSettingNotification(g_svcStatusHandle, &GUID_BRIGHTNESS_VAL, DEVICE_NOTIFY_SERVICE_HANDLE);
     g_notifyDisplay = RegisterPowerSettingNotification(g_svcStatusHandle, &GUID_DISPLAY_STATE_VAL, DEVICE_NOTIFY_SERVICE_HANDLE);
 
     ReportStatus(SERVICE_RUNNING, 0, 0);
     LogEvent(EVENTLOG_INFORMATION_TYPE, L"PBS Service Started");
 
-    SyncBrightness(); 
+    SyncOrForward();
 
     WaitForSingleObject(g_svcStopEvent.get(), INFINITE);
 
     g_isStopping = true;
     ReportStatus(SERVICE_STOP_PENDING, 0, 1000);
 
+    // 在锁外等待回调结束：回调可能调用 ScheduleLeaseCheck() 获取 g_timerMutex
+    HANDLE timer = nullptr;
+    HANDLE leaseTimer = nullptr;
     {
         std::lock_guard<std::mutex> lock(g_timerMutex);
-        if (g_timer) {
-            DeleteTimerQueueTimer(nullptr, g_timer, INVALID_HANDLE_VALUE);
-            g_timer = nullptr;
-        }
+        timer = g_timer;
+        leaseTimer = g_leaseTimer;
+        g_timer = nullptr;
+        g_leaseTimer = nullptr;
+    }
+    if (timer) DeleteTimerQueueTimer(nullptr, timer, INVALID_HANDLE_VALUE);
+    if (leaseTimer) DeleteTimerQueueTimer(nullptr, leaseTimer, INVALID_HANDLE_VALUE);
+    {
+        std::lock_guard<std::mutex> lock(g_leaseMutex);
+        g_lease.reset();
     }
 
     if (g_notifyBrightness) UnregisterPowerSettingNotification(g_notifyBrightness);
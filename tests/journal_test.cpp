@@ -0,0 +1,185 @@
+// ================= Sync Journal Checks =================
+// Exercises SyncJournal (pbs_journal.h) against a scratch ProgramData
+// directory: resuming from a checkpoint, skipping a torn or corrupt tail,
+// the scheme GUID shift check, compaction after Done, and refusing a
+// journal file or directory that is a symbolic link.
+//
+// Needs an elevated prompt (symbolic links) and at least one power scheme.
+// Build: cl /nologo /W4 /EHsc /std:c++17 /DUNICODE /D_UNICODE /I. tests\journal_test.cpp
+
+#include <windows.h>
+#include <powrprof.h>
+#include <cstdio>
+#include <string>
+#include "pbs_journal.h"
+
+#pragma comment(lib, "PowrProf.lib")
+#pragma comment(lib, "Kernel32.lib")
+
+int g_failed = 0;
+std::wstring g_base;  // Stands in for %ProgramData%
+
+static void Check(bool ok, const char* what) {
+    printf("%s %s\n", ok ? "ok  " : "FAIL", what);
+    if (!ok) g_failed++;
+}
+
+static std::wstring JournalPath(const wchar_t* name) {
+    return g_base + L"\\PowerBrightnessSync\\" + name;
+}
+
+static LONGLONG FileSize(const std::wstring& path) {
+    WIN32_FILE_ATTRIBUTE_DATA data{};
+    if (!GetFileAttributesExW(path.c_str(), GetFileExInfoStandard, &data)) return -1;
+    return (static_cast<LONGLONG>(data.nFileSizeHigh) << 32) | data.nFileSizeLow;
+}
+
+static void AppendRaw(const std::wstring& path, const void* bytes, DWORD size) {
+    HANDLE h = CreateFileW(path.c_str(), FILE_APPEND_DATA, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+                           OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (h == INVALID_HANDLE_VALUE) return;
+    DWORD written = 0;
+    WriteFile(h, bytes, size, &written, nullptr);
+    CloseHandle(h);
+}
+
+static void TestResume(const GUID& first) {
+    const DWORD target = 37;
+    {
+        SyncJournal journal(L"resume.journal");
+        Check(journal.ResumeIndex(target) == 0, "empty journal starts at index 0");
+        journal.Begin(target, 0);
+        journal.Progress(1, first);
+    }
+
+    // Each block below opens the journal afresh, like a restarted engine
+    {
+        SyncJournal journal(L"resume.journal");
+        Check(journal.ResumeIndex(target) == 1, "killed sweep resumes after the last checkpoint");
+        Check(journal.ResumeIndex(target + 1) == 0, "different target starts over");
+    }
+
+    JournalRecord bad{ kJournalMagic, kJournalDone, target, 0, GUID{}, 0 };
+    bad.check = JournalCheck(bad) ^ 1;
+    AppendRaw(JournalPath(L"resume.journal"), &bad, sizeof(bad));
+    {
+        SyncJournal journal(L"resume.journal");
+        Check(journal.ResumeIndex(target) == 1, "record with a bad checksum is skipped");
+    }
+
+    const char torn[10] = { 'P', 'B', 'J', 'L' };
+    AppendRaw(JournalPath(L"resume.journal"), torn, sizeof(torn));
+    {
+        SyncJournal journal(L"resume.journal");
+        Check(journal.ResumeIndex(target) == 1, "torn tail is skipped");
+        journal.Begin(target, 1);  // Must land over the torn bytes, not after them
+        journal.Done();
+    }
+    {
+        SyncJournal journal(L"resume.journal");
+        Check(journal.ResumeIndex(target) == 0, "records written after a torn tail stay readable");
+    }
+
+    {
+        SyncJournal journal(L"resume.journal");
+        GUID moved = first;
+        moved.Data1 ^= 0x5A5A5A5A;
+        journal.Begin(target, 0);
+        journal.Progress(1, moved);
+    }
+    {
+        SyncJournal journal(L"resume.journal");
+        Check(journal.ResumeIndex(target) == 0, "checkpoint for a scheme no longer at that index is ignored");
+    }
+
+    {
+        SyncJournal journal(L"resume.journal");
+        journal.Begin(target, 0);
+        journal.Progress(1, first);
+        journal.Done();
+    }
+    {
+        SyncJournal journal(L"resume.journal");
+        Check(journal.ResumeIndex(target) == 0, "finished sweep starts over");
+    }
+}
+
+static void TestCompaction(const GUID& first) {
+    {
+        SyncJournal journal(L"compact.journal");
+        journal.Begin(50, 0);
+        DWORD records = static_cast<DWORD>(kJournalCompactBytes / sizeof(JournalRecord)) + 2;
+        for (DWORD i = 1; i <= records; i++) journal.Progress(i, first);
+        journal.Done();
+    }
+    Check(FileSize(JournalPath(L"compact.journal")) == 0, "Done truncates a journal over the size limit");
+
+    SyncJournal journal(L"compact.journal");
+    Check(journal.ResumeIndex(50) == 0, "compacted journal starts over");
+}
+
+static void TestRefusesLinks(const GUID& first) {
+    // A link in place of the journal file must not be followed
+    std::wstring victim = g_base + L"\\victim.txt";
+    HANDLE h = CreateFileW(victim.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (h != INVALID_HANDLE_VALUE) CloseHandle(h);
+    if (!CreateSymbolicLinkW(JournalPath(L"link.journal").c_str(), victim.c_str(), 0)) {
+        Check(false, "create file symlink (needs elevation)");
+        return;
+    }
+    {
+        SyncJournal journal(L"link.journal");
+        journal.Begin(50, 0);
+        journal.Progress(1, first);
+        journal.Done();
+    }
+    Check(FileSize(victim) == 0, "symlinked journal file is not written through");
+
+    // A link in place of the journal directory must not be used either
+    std::wstring other = g_base + L"\\other";
+    std::wstring redirect = other + L"\\PowerBrightnessSync";
+    std::wstring target = g_base + L"\\redirected";
+    CreateDirectoryW(other.c_str(), nullptr);
+    CreateDirectoryW(target.c_str(), nullptr);
+    if (!CreateSymbolicLinkW(redirect.c_str(), target.c_str(), SYMBOLIC_LINK_FLAG_DIRECTORY)) {
+        Check(false, "create directory symlink (needs elevation)");
+        return;
+    }
+    SetEnvironmentVariableW(L"ProgramData", other.c_str());
+    {
+        SyncJournal journal(L"sync.journal");
+        journal.Begin(50, 0);
+        journal.Progress(1, first);
+    }
+    SetEnvironmentVariableW(L"ProgramData", g_base.c_str());
+    Check(GetFileAttributesW((target + L"\\sync.journal").c_str()) == INVALID_FILE_ATTRIBUTES,
+          "symlinked journal directory is not used");
+}
+
+int wmain() {
+    GUID first{};
+    DWORD size = sizeof(first);
+    if (PowerEnumerate(nullptr, nullptr, nullptr, ACCESS_SCHEME, 0, reinterpret_cast<UCHAR*>(&first), &size) !=
+        ERROR_SUCCESS) {
+        printf("FAIL no power scheme to checkpoint against\n");
+        return 1;
+    }
+
+    wchar_t temp[MAX_PATH];
+    DWORD len = GetTempPathW(MAX_PATH, temp);
+    if (len == 0 || len >= MAX_PATH) return 1;
+    g_base = std::wstring(temp, len) + L"pbs_journal_test_" + std::to_wstring(GetCurrentProcessId());
+    CreateDirectoryW(g_base.c_str(), nullptr);
+    SetEnvironmentVariableW(L"ProgramData", g_base.c_str());
+
+    TestResume(first);
+    TestCompaction(first);
+    TestRefusesLinks(first);
+
+    if (g_failed) {
+        printf("%d journal check(s) failed\n", g_failed);
+        return 1;
+    }
+    printf("All journal checks passed\n");
+    return 0;
+}
@@ -0,0 +1,381 @@
+// ================= Engine Lease Harness =================
+// Starts several engine processes that share one EngineLease (pbs_lease.h),
+// fires simulated power events at all of them and counts how many scheme
+// writes and sweeps each event causes. Each engine routes its events through
+// the same EngineEvents (pbs_engine.h) as the tray app and the Lite build;
+// only the timers and the sync itself are stand-ins. The power store is a
+// shared array of simulated AC/DC values, and an engine only writes a value
+// that differs, the same way PerformSync() does with PowerWrite*ValueIndex.
+// The service routes its events separately and is not covered here.
+//
+// Scenarios:
+//   steady    3 engines, 5 events: one sweep and one copy of writes per
+//             event, and no engine wakes up once the events are handled
+//   failover  the holder is killed, the next event is still synced once
+//   hung      the holder stalls mid-sweep, is replaced, and drops its sweep
+//   startup   an engine started after the holder died takes over and syncs,
+//             and one started next to the new holder gets its sync forwarded
+//
+// Needs an elevated prompt, like the engines themselves.
+// Build: cl /nologo /W4 /EHsc /std:c++17 /DUNICODE /D_UNICODE /I. tests\lease_test.cpp
+
+#define PBS_LEASE_PREFIX L"Global\\PBS_LeaseTest_"
+
+#include <windows.h>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include "pbs_lease.h"
+#include "pbs_engine.h"
+
+#pragma comment(lib, "Kernel32.lib")
+
+constexpr int kSchemes = 8;
+constexpr DWORD kHangMs = 6000;       // Past two lease checks after the forward
+constexpr DWORD kIdleMs = 3000;       // Window in which idle engines must not wake
+constexpr DWORD kSettleMs = 10000;    // Upper bound for an event to be synced
+constexpr DWORD kQuietMs = 1500;      // Extra wait to catch late duplicate sweeps
+
+const wchar_t* const kStoreName = L"Local\\PBS_LeaseTest_Store";
+const wchar_t* const kQuitName = L"Local\\PBS_LeaseTest_Quit";
+
+struct TestStore {
+    volatile LONG ac[kSchemes];
+    volatile LONG dc[kSchemes];
+    volatile LONG target;       // Value the next sweep should write
+    volatile LONG writes;       // Simulated PowerWrite*ValueIndex calls
+    volatile LONG sweeps;       // Sweeps that reached MarkSynced
+    volatile LONG aborted;      // Sweeps dropped because Heartbeat() failed
+    volatile LONG ready;        // Engines that entered their event loop
+    volatile LONG lastSweeper;  // Process ID of the last engine that swept
+    volatile LONG hangMs;       // One-shot stall for the next sweep
+    volatile LONG wakeups;      // Event loop wakeups across all engines
+};
+
+static std::wstring EventName(int id) {
+    return L"Local\\PBS_LeaseTest_Event" + std::to_wstring(id);
+}
+
+// ================= Engine Process =================
+
+static void SimulatedSync(EngineLease& lease, TestStore* store) {
+    LONG gen = lease.Generation();
+    LONG target = store->target;
+    InterlockedExchange(&store->lastSweeper, static_cast<LONG>(GetCurrentProcessId()));
+
+    for (int i = 0; i < kSchemes; i++) {
+        if (i == kSchemes / 2) {
+            DWORD hang = static_cast<DWORD>(InterlockedExchange(&store->hangMs, 0));
+            if (hang) Sleep(hang); // Blocks the event loop, wakes and lease checks included
+        }
+        if (!lease.Heartbeat()) {
+            InterlockedIncrement(&store->aborted);
+            return;
+        }
+        if (store->ac[i] != target) {
+            InterlockedExchange(&store->ac[i], target);
+            InterlockedIncrement(&store->writes);
+        }
+        if (store->dc[i] != target) {
+            InterlockedExchange(&store->dc[i], target);
+            InterlockedIncrement(&store->writes);
+        }
+    }
+    InterlockedIncrement(&store->sweeps);
+    lease.MarkSynced(gen);
+}
+
+static void ArmTimer(HANDLE timer, DWORD ms) {
+    LARGE_INTEGER due{};
+    due.QuadPart = -static_cast<LONGLONG>(ms) * 10000;
+    SetWaitableTimer(timer, &due, 0, nullptr, nullptr, FALSE);
+}
+
+struct EngineContext {
+    EngineLease* lease;
+    TestStore* store;
+    HANDLE debounce;
+    HANDLE check;
+    DWORD debounceMs;
+};
+
+// Same event routing as the tray's WndProc, with waitable timers for SetTimer.
+static int RunEngine(int id, DWORD debounceMs) {
+    HANDLE mapping = OpenFileMappingW(FILE_MAP_ALL_ACCESS, FALSE, kStoreName);
+    if (!mapping) return 2;
+    auto* store = static_cast<TestStore*>(MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(TestStore)));
+    if (!store) return 2;
+
+    HANDLE quit = OpenEventW(SYNCHRONIZE, FALSE, kQuitName);
+    HANDLE power = OpenEventW(SYNCHRONIZE | EVENT_MODIFY_STATE, FALSE, EventName(id).c_str());
+    HANDLE debounce = CreateWaitableTimerW(nullptr, FALSE, nullptr);
+    HANDLE check = CreateWaitableTimerW(nullptr, FALSE, nullptr);
+    HANDLE wake = CreateEventW(nullptr, FALSE, FALSE, nullptr); // Stands in for WM_LEASE_WAKE
+    if (!quit || !power || !debounce || !check || !wake) return 2;
+
+    EngineLease lease([](void* ctx) { SetEvent(static_cast<HANDLE>(ctx)); }, wake);
+    if (!lease.valid()) return 3;
+
+    EngineContext context{ &lease, store, debounce, check, debounceMs };
+    EngineHooks hooks{};
+    hooks.armDebounce = [](void* ctx) {
+        auto* c = static_cast<EngineContext*>(ctx);
+        ArmTimer(c->debounce, c->debounceMs);
+    };
+    hooks.armLeaseCheck = [](void* ctx) { ArmTimer(static_cast<EngineContext*>(ctx)->check, kLeaseTimeoutMs); };
+    hooks.sync = [](void* ctx) {
+        auto* c = static_cast<EngineContext*>(ctx);
+        SimulatedSync(*c->lease, c->store);
+    };
+    hooks.ctx = &context;
+
+    EngineEvents engine(lease, hooks);
+    engine.Start();
+    InterlockedIncrement(&store->ready);
+
+    HANDLE handles[] = { quit, power, debounce, check, wake };
+    for (;;) {
+        DWORD r = WaitForMultipleObjects(ARRAYSIZE(handles), handles, FALSE, INFINITE);
+        if (r == WAIT_OBJECT_0) break;
+        InterlockedIncrement(&store->wakeups);
+        switch (r - WAIT_OBJECT_0) {
+        case 1:
+            engine.OnPowerEvent();
+            break;
+        case 2:
+            engine.OnDebounce();
+            break;
+        case 3:
+            engine.OnLeaseCheck();
+            break;
+        case 4:
+            engine.OnWake();
+            break;
+        default:
+            return 4;
+        }
+    }
+    return 0;
+}
+
+// ================= Driver =================
+
+struct Engine {
+    HANDLE process = nullptr;
+    HANDLE power = nullptr;
+    DWORD pid = 0;
+};
+
+static bool SpawnEngine(HANDLE job, int id, DWORD debounceMs, Engine& out) {
+    wchar_t exe[MAX_PATH];
+    if (!GetModuleFileNameW(nullptr, exe, MAX_PATH)) return false;
+
+    out.power = CreateEventW(nullptr, FALSE, FALSE, EventName(id).c_str());
+    if (!out.power) return false;
+
+    std::wstring cmd = L"\"" + std::wstring(exe) + L"\" --engine " + std::to_wstring(id) + L" " +
+                       std::to_wstring(debounceMs);
+    STARTUPINFOW si{ sizeof(si) };
+    PROCESS_INFORMATION pi{};
+    if (!CreateProcessW(exe, &cmd[0], nullptr, nullptr, FALSE, CREATE_SUSPENDED, nullptr, nullptr, &si, &pi)) {
+        return false;
+    }
+    AssignProcessToJobObject(job, pi.hProcess);
+    ResumeThread(pi.hThread);
+    CloseHandle(pi.hThread);
+    out.process = pi.hProcess;
+    out.pid = pi.dwProcessId;
+    return true;
+}
+
+static bool WaitFor(const volatile LONG& value, LONG expected, DWORD timeoutMs) {
+    ULONGLONG start = GetTickCount64();
+    while (value < expected) {
+        if (GetTickCount64() - start > timeoutMs) return false;
+        Sleep(50);
+    }
+    return true;
+}
+
+class Scenario {
+public:
+    Scenario(const char* name, TestStore* store, HANDLE quit) : name_(name), store_(store), quit_(quit) {
+        ZeroMemory(store_, sizeof(TestStore));
+        ResetEvent(quit_);
+        job_ = CreateJobObjectW(nullptr, nullptr);
+        JOBOBJECT_EXTENDED_LIMIT_INFORMATION limit{};
+        limit.BasicLimitInformation.LimitFlags = JOB_OBJECT_LIMIT_KILL_ON_JOB_CLOSE;
+        SetInformationJobObject(job_, JobObjectExtendedLimitInformation, &limit, sizeof(limit));
+    }
+
+    ~Scenario() {
+        SetEvent(quit_);
+        for (Engine& e : engines_) {
+            if (e.process) WaitForSingleObject(e.process, 5000);
+        }
+        CloseHandle(job_); // Kills anything still running
+        for (Engine& e : engines_) {
+            if (e.process) CloseHandle(e.process);
+            if (e.power) CloseHandle(e.power);
+        }
+    }
+
+    Scenario(const Scenario&) = delete;
+    Scenario& operator=(const Scenario&) = delete;
+
+    // Startup syncs do not count towards the events fired afterwards
+    bool Start(std::initializer_list<DWORD> debounces) {
+        for (DWORD ms : debounces) {
+            if (!AddEngine(ms)) return false;
+        }
+        Sleep(kQuietMs);
+        InterlockedExchange(&store_->writes, 0);
+        InterlockedExchange(&store_->sweeps, 0);
+        return true;
+    }
+
+    bool AddEngine(DWORD debounceMs) {
+        Engine e;
+        if (!SpawnEngine(job_, static_cast<int>(engines_.size()), debounceMs, e)) return Fail("could not start engine");
+        engines_.push_back(e);
+        if (!WaitFor(store_->ready, static_cast<LONG>(engines_.size()), kSettleMs)) {
+            return Fail("engine did not start (not elevated?)");
+        }
+        return true;
+    }
+
+    // Sets a new target and signals every live engine, as a broadcast
+    // WM_POWERBROADCAST would. Returns once a sweep covered it.
+    bool Fire() {
+        LONG sweeps = store_->sweeps;
+        InterlockedIncrement(&store_->target);
+        for (Engine& e : engines_) {
+            if (e.process) SetEvent(e.power);
+        }
+        events_++;
+        if (!WaitFor(store_->sweeps, sweeps + 1, kSettleMs)) return Fail("event was never synced");
+        Sleep(kQuietMs);
+        return true;
+    }
+
+    // Starts one more engine with a new target pending, as if the settings
+    // changed while it was not running. Returns once a sweep covered it.
+    bool Join(DWORD debounceMs) {
+        LONG sweeps = store_->sweeps;
+        InterlockedIncrement(&store_->target);
+        events_++;
+        if (!AddEngine(debounceMs)) return false;
+        if (!WaitFor(store_->sweeps, sweeps + 1, kSettleMs)) return Fail("startup sync was never done");
+        Sleep(kQuietMs);
+        return true;
+    }
+
+    bool KillHolder() {
+        for (Engine& e : engines_) {
+            if (e.process && e.pid == static_cast<DWORD>(store_->lastSweeper)) {
+                TerminateProcess(e.process, 1);
+                WaitForSingleObject(e.process, INFINITE);
+                CloseHandle(e.process);
+                e.process = nullptr;
+                return true;
+            }
+        }
+        return Fail("no holder to kill");
+    }
+
+    void Hang(DWORD ms) { InterlockedExchange(&store_->hangMs, static_cast<LONG>(ms)); }
+
+    // Once the events are handled and the last lease check has fired, no
+    // engine may wake up again
+    bool ExpectIdle() {
+        Sleep(kLeaseTimeoutMs);
+        LONG before = store_->wakeups;
+        Sleep(kIdleMs);
+        LONG woke = store_->wakeups - before;
+        printf("%-8s wakeups while idle for %u ms: %ld\n", name_, static_cast<unsigned>(kIdleMs), woke);
+        return woke == 0 || Fail("engines woke up while idle");
+    }
+
+    bool Expect(LONG aborted) {
+        LONG wantWrites = events_ * kSchemes * 2;
+        printf("%-8s events=%ld writes=%ld (%.1f per event, want %d) sweeps=%ld aborted=%ld\n", name_,
+               events_, store_->writes, events_ ? static_cast<double>(store_->writes) / events_ : 0.0,
+               kSchemes * 2, store_->sweeps, store_->aborted);
+        if (store_->writes != wantWrites || store_->sweeps != events_ || store_->aborted != aborted) {
+            return Fail("unexpected counts");
+        }
+        return ok_;
+    }
+
+    bool ok() const { return ok_; }
+
+private:
+    bool Fail(const char* why) {
+        printf("FAIL %s: %s\n", name_, why);
+        ok_ = false;
+        return false;
+    }
+
+    const char* name_;
+    TestStore* store_;
+    HANDLE quit_;
+    HANDLE job_ = nullptr;
+    std::vector<Engine> engines_;
+    LONG events_ = 0;
+    bool ok_ = true;
+};
+
+static bool RunSteady(TestStore* store, HANDLE quit) {
+    Scenario s("steady", store, quit);
+    if (!s.Start({ 600, 600, 800 })) return false;
+    for (int i = 0; i < 5; i++) {
+        if (!s.Fire()) return false;
+    }
+    return s.Expect(0) && s.ExpectIdle();
+}
+
+static bool RunFailover(TestStore* store, HANDLE quit) {
+    Scenario s("failover", store, quit);
+    if (!s.Start({ 600, 600, 800 })) return false;
+    if (!s.Fire() || !s.KillHolder() || !s.Fire()) return false;
+    return s.Expect(0);
+}
+
+static bool RunHung(TestStore* store, HANDLE quit) {
+    Scenario s("hung", store, quit);
+    if (!s.Start({ 600, 600, 800 })) return false;
+    s.Hang(kHangMs);
+    if (!s.Fire()) return false;
+    Sleep(kHangMs); // Let the stalled engine wake up and notice
+    return s.Expect(1);
+}
+
+static bool RunStartup(TestStore* store, HANDLE quit) {
+    Scenario s("startup", store, quit);
+    if (!s.Start({ 600 }) || !s.KillHolder()) return false;
+    if (!s.Join(600) || !s.Join(800)) return false;
+    return s.Expect(0);
+}
+
+int wmain(int argc, wchar_t** argv) {
+    if (argc >= 4 && wcscmp(argv[1], L"--engine") == 0) {
+        return RunEngine(_wtoi(argv[2]), static_cast<DWORD>(_wtoi(argv[3])));
+    }
+
+    HANDLE mapping = CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, sizeof(TestStore), kStoreName);
+    if (!mapping) return 1;
+    auto* store = static_cast<TestStore*>(MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(TestStore)));
+    HANDLE quit = CreateEventW(nullptr, TRUE, FALSE, kQuitName);
+    if (!store || !quit) return 1;
+
+    // Each scenario tears its engines down before the next starts, so every
+    // run begins with a fresh lease block.
+    bool ok = RunSteady(store, quit);
+    ok = RunFailover(store, quit) && ok;
+    ok = RunHung(store, quit) && ok;
+    ok = RunStartup(store, quit) && ok;
+
+    printf(ok ? "All lease checks passed\n" : "Lease checks failed\n");
+    return ok ? 0 : 1;
+}
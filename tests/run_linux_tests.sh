@@ -0,0 +1,76 @@
+#!/bin/sh
+# Replays the recorded uevent streams in tests/uevents through pbs_linux
+# against a copy of the fake sysfs tree, passing on each stream's "# args:"
+# line, and checks the printed counters against its "# expect:" line. Then
+# runs the daemon on the real netlink socket for a few seconds and checks
+# that it only woke up for uevents the kernel actually sent.
+#
+# Usage: tests/run_linux_tests.sh [path/to/pbs_linux]
+
+BIN=${1:-./pbs_linux}
+HERE=$(cd "$(dirname "$0")" && pwd)
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+FAILED=0
+
+fresh_sysfs() {
+    rm -rf "$WORK/sysfs"
+    cp -R "$HERE/sysfs" "$WORK/sysfs"
+}
+
+check() { # name output expected-tokens...
+    name=$1; out=$2; shift 2
+    for tok in "$@"; do
+        case "$tok" in
+        brightness=*)
+            got="brightness=$(cat "$WORK/sysfs/class/backlight/test_backlight/brightness")" ;;
+        *)
+            got=$(printf '%s\n' "$out" | tr ' ' '\n' | grep "^${tok%%=*}=") ;;
+        esac
+        if [ "$got" != "$tok" ]; then
+            echo "FAIL $name: expected $tok, got ${got:-nothing} ($out)"
+            FAILED=1
+            return
+        fi
+    done
+    echo "ok   $name: $out"
+}
+
+for stream in "$HERE"/uevents/*.txt; do
+    fresh_sysfs
+    expect=$(sed -n 's/^# expect: //p' "$stream")
+    args=$(sed -n 's/^# args: //p' "$stream")
+    # shellcheck disable=SC2086
+    out=$("$BIN" --sysfs "$WORK/sysfs" $args --replay "$stream")
+    # shellcheck disable=SC2086
+    check "$(basename "$stream")" "$out" $expect
+done
+
+# Idle: the real socket may carry unrelated uevents (the runner's own
+# devices), so only require that none of them reached the debounce, and take
+# the wakeups from the kernel's count of voluntary sleeps rather than from
+# the daemon itself. Each one must be a uevent the daemon received.
+ctxt() { sed -n 's/^voluntary_ctxt_switches:[[:space:]]*//p' "/proc/$1/status"; }
+
+fresh_sysfs
+"$BIN" --sysfs "$WORK/sysfs" > "$WORK/idle.out" &
+pid=$!
+sleep 1
+before=$(ctxt "$pid")
+sleep 3
+after=$(ctxt "$pid")
+kill -USR1 "$pid"
+sleep 1
+kill -TERM "$pid"
+wait "$pid"
+out=$(tail -n 1 "$WORK/idle.out")
+check idle "$out" accepted=0 syncs=0 writes=0
+uevents=$(printf '%s\n' "$out" | tr ' ' '\n' | sed -n 's/^uevents=//p')
+if [ -z "$before" ] || [ -z "$after" ] || [ $((after - before)) -gt "${uevents:-0}" ]; then
+    echo "FAIL idle: ${before:-?} -> ${after:-?} voluntary context switches in 3s, uevents=${uevents:-?}"
+    FAILED=1
+else
+    echo "ok   idle: $((after - before)) voluntary context switches in 3s, uevents=$uevents"
+fi
+
+exit $FAILED